@@ -0,0 +1,584 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @brief URF page kept in run-length form
+ * @file urf_page.c
+ * @author Neil 'Superna' Armstrong <superna9999@gmail.com> (C) 2010
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "urf_page.h"
+
+#define PROGRAM "urf_page"
+
+#ifdef URF_DEBUG
+#define dprintf(format, ...) fprintf(stderr, "DEBUG: (" PROGRAM ") " format, __VA_ARGS__)
+#else
+#define dprintf(format, ...)
+#endif
+
+static int grow(void ** buf, size_t * alloc, size_t needed, size_t elem_size)
+{
+    size_t n = (*alloc ? *alloc : 64);
+    void * p;
+
+    if(needed <= *alloc)
+        return 0;
+
+    while(n < needed)
+        n *= 2;
+
+    p = realloc(*buf, n*elem_size);
+    if(p == NULL)
+        return -1;
+
+    *buf = p;
+    *alloc = n;
+
+    return 0;
+}
+
+static int read_full(int fd, uint8_t * buf, size_t len)
+{
+    ssize_t ret;
+
+    while(len)
+    {
+        ret = read(fd, buf, len);
+        if(ret < 1)
+            return -1;
+        buf += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+static int pixel_is_white(struct urf_page * page, uint32_t pixel, unsigned count)
+{
+    size_t i;
+
+    for(i = 0 ; i < (size_t)count*page->pixel_bytes ; ++i)
+        if(page->pixels[pixel + i] != 0xFF)
+            return 0;
+
+    return 1;
+}
+
+// Appends a run to the current row, merging it with the previous one when possible
+static int add_run(struct urf_page * page, uint32_t row_start, uint32_t length, uint32_t pixel, int literal)
+{
+    struct urf_run * prev;
+
+    if(page->run_count > row_start)
+    {
+        prev = &page->runs[page->run_count-1];
+
+        if(literal && prev->literal &&
+           prev->pixel + prev->length*page->pixel_bytes == pixel)
+        {
+            prev->length += length;
+            return 0;
+        }
+
+        if(!literal && !prev->literal && prev->pixel == pixel)
+        {
+            prev->length += length;
+            return 0;
+        }
+    }
+
+    if(grow((void **)&page->runs, &page->run_alloc, page->run_count+1, sizeof(struct urf_run)))
+        return -1;
+
+    page->runs[page->run_count].length = length;
+    page->runs[page->run_count].pixel = pixel;
+    page->runs[page->run_count].literal = literal;
+    ++page->run_count;
+
+    return 0;
+}
+
+static int rows_equal(struct urf_page * page, struct urf_row * row, uint32_t run_start, uint32_t run_count)
+{
+    struct urf_run * a;
+    struct urf_run * b;
+    uint32_t i;
+
+    if(row->run_count != run_count)
+        return 0;
+
+    for(i = 0 ; i < run_count ; ++i)
+    {
+        a = &page->runs[row->run + i];
+        b = &page->runs[run_start + i];
+
+        if(a->length != b->length || a->literal != b->literal)
+            return 0;
+
+        if(a->pixel != b->pixel &&
+           memcmp(&page->pixels[a->pixel], &page->pixels[b->pixel],
+                  (a->literal ? a->length : 1)*page->pixel_bytes) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Closes the current row, folding it into the previous row when both are identical
+static int finish_row(struct urf_page * page, uint32_t run_start, size_t pixel_start, uint32_t repeat)
+{
+    struct urf_row * prev;
+
+    if(page->row_count)
+    {
+        prev = &page->rows[page->row_count-1];
+
+        if(rows_equal(page, prev, run_start, page->run_count-run_start))
+        {
+            prev->repeat += repeat;
+            page->run_count = run_start;
+            page->pixel_size = pixel_start;
+            return 0;
+        }
+    }
+
+    if(grow((void **)&page->rows, &page->row_alloc, page->row_count+1, sizeof(struct urf_row)))
+        return -1;
+
+    page->rows[page->row_count].run = run_start;
+    page->rows[page->row_count].run_count = page->run_count-run_start;
+    page->rows[page->row_count].repeat = repeat;
+    ++page->row_count;
+
+    return 0;
+}
+
+static void shrink(struct urf_page * page)
+{
+    void * p;
+
+    if(page->row_count && (p = realloc(page->rows, page->row_count*sizeof(struct urf_row))) != NULL)
+    {
+        page->rows = p;
+        page->row_alloc = page->row_count;
+    }
+
+    if(page->run_count && (p = realloc(page->runs, page->run_count*sizeof(struct urf_run))) != NULL)
+    {
+        page->runs = p;
+        page->run_alloc = page->run_count;
+    }
+
+    if(page->pixel_size && (p = realloc(page->pixels, page->pixel_size)) != NULL)
+    {
+        page->pixels = p;
+        page->pixel_alloc = page->pixel_size;
+    }
+}
+
+int urf_page_decode(int fd, unsigned width, unsigned height, unsigned bpp, struct urf_page * page)
+{
+    // We should be at raster start
+    unsigned cur_line = 0;
+    unsigned pos = 0;
+    unsigned n;
+    uint8_t line_repeat_byte = 0;
+    unsigned line_repeat = 0;
+    int8_t packbit_code = 0;
+    unsigned pixel_bytes = (bpp/8);
+    uint32_t run_start;
+    size_t pixel_start;
+    uint32_t pixel;
+    unsigned long repeat, literal, blank;
+    int ret = 0;
+
+    memset(page, 0, sizeof(*page));
+    page->width = width;
+    page->height = height;
+    page->bpp = bpp;
+    page->pixel_bytes = pixel_bytes;
+
+    if(pixel_bytes == 0 || width == 0)
+        return -1;
+
+    if(grow((void **)&page->pixels, &page->pixel_alloc, pixel_bytes, 1))
+        return -1;
+    memset(&page->pixels[URF_PAGE_WHITE], 0xFF, pixel_bytes);
+    page->pixel_size = pixel_bytes;
+
+    while(cur_line < height)
+    {
+        if(read(fd, &line_repeat_byte, 1) < 1)
+        {
+            dprintf("l%06d : line_repeat EOF at %lu\n", cur_line, lseek(fd, 0, SEEK_CUR));
+            ret = 1;
+            break;
+        }
+
+        line_repeat = (unsigned)line_repeat_byte + 1;
+
+        dprintf("l%06d : next actions for %d lines\n", cur_line, line_repeat);
+
+        // Start of line
+        pos = 0;
+        run_start = page->run_count;
+        pixel_start = page->pixel_size;
+        repeat = literal = blank = 0;
+
+        do
+        {
+            if(read(fd, &packbit_code, 1) < 1)
+            {
+                dprintf("p%06dl%06d : packbit_code EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
+                ret = 1;
+                break;
+            }
+
+            dprintf("p%06dl%06d: Raster code %02X='%d'.\n", pos, cur_line, (uint8_t)packbit_code, packbit_code);
+
+            if(packbit_code == -128)
+            {
+                dprintf("\tp%06dl%06d : blank rest of line.\n", pos, cur_line);
+                if(add_run(page, run_start, width-pos, URF_PAGE_WHITE, 0))
+                    return -1;
+                blank += width-pos;
+                pos = width;
+            }
+            else if(packbit_code >= 0)
+            {
+                n = packbit_code+1;
+                if(n > width-pos)
+                {
+                    dprintf("\tp%06dl%06d : Forced end of line for pixel repeat.\n", pos, cur_line);
+                    n = width-pos;
+                }
+
+                if(grow((void **)&page->pixels, &page->pixel_alloc, page->pixel_size+pixel_bytes, 1))
+                    return -1;
+
+                if(read_full(fd, &page->pixels[page->pixel_size], pixel_bytes))
+                {
+                    dprintf("p%06dl%06d : pixel repeat EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
+                    ret = 1;
+                    break;
+                }
+
+                dprintf("\tp%06dl%06d : Repeat pixel for %d times.\n", pos, cur_line, n);
+
+                // White runs all share the page white pixel
+                if(pixel_is_white(page, page->pixel_size, 1))
+                    pixel = URF_PAGE_WHITE;
+                else
+                {
+                    pixel = page->pixel_size;
+                    page->pixel_size += pixel_bytes;
+                }
+
+                if(add_run(page, run_start, n, pixel, 0))
+                    return -1;
+                repeat += n;
+                pos += n;
+            }
+            else
+            {
+                n = (-(int)packbit_code)+1;
+
+                dprintf("\tp%06dl%06d : Copy %d verbatim pixels.\n", pos, cur_line, n);
+
+                // Like the pixel repeat, the copy stops reading at the end of line
+                if(n > width-pos)
+                {
+                    dprintf("\tp%06dl%06d : Forced end of line for pixel copy.\n", pos, cur_line);
+                    n = width-pos;
+                }
+
+                if(grow((void **)&page->pixels, &page->pixel_alloc, page->pixel_size+n*pixel_bytes, 1))
+                    return -1;
+
+                if(read_full(fd, &page->pixels[page->pixel_size], n*pixel_bytes))
+                {
+                    dprintf("p%06dl%06d : literal_pixel EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
+                    ret = 1;
+                    break;
+                }
+
+                pixel = page->pixel_size;
+                page->pixel_size += n*pixel_bytes;
+
+                if(add_run(page, run_start, n, pixel, 1))
+                    return -1;
+                literal += n;
+                pos += n;
+            }
+        }
+        while(pos < width);
+
+        if(ret)
+        {
+            // Drop the partial line
+            page->run_count = run_start;
+            page->pixel_size = pixel_start;
+            break;
+        }
+
+        if(line_repeat > height-cur_line)
+            line_repeat = height-cur_line;
+
+        dprintf("\tl%06d : End Of line, drawing %d times.\n", cur_line, line_repeat);
+
+        page->stats.repeat_pixels += repeat*line_repeat;
+        page->stats.literal_pixels += literal*line_repeat;
+        page->stats.blank_pixels += blank*line_repeat;
+
+        if(finish_row(page, run_start, pixel_start, line_repeat))
+            return -1;
+
+        cur_line += line_repeat;
+    }
+
+    if(cur_line < height)
+    {
+        run_start = page->run_count;
+        if(add_run(page, run_start, width, URF_PAGE_WHITE, 0) ||
+           finish_row(page, run_start, page->pixel_size, height-cur_line))
+            return -1;
+    }
+
+    shrink(page);
+
+    return ret;
+}
+
+void urf_page_free(struct urf_page * page)
+{
+    free(page->rows);
+    free(page->runs);
+    free(page->pixels);
+    memset(page, 0, sizeof(*page));
+}
+
+size_t urf_page_memory(struct urf_page * page)
+{
+    return sizeof(*page) +
+           page->row_alloc*sizeof(struct urf_row) +
+           page->run_alloc*sizeof(struct urf_run) +
+           page->pixel_alloc;
+}
+
+void urf_page_expand_row(struct urf_page * page, unsigned row, uint8_t line[])
+{
+    struct urf_row * r = &page->rows[row];
+    struct urf_run * run;
+    uint8_t * pixel;
+    uint32_t i, j;
+
+    for(i = 0 ; i < r->run_count ; ++i)
+    {
+        run = &page->runs[r->run + i];
+        pixel = &page->pixels[run->pixel];
+
+        if(run->literal)
+        {
+            memcpy(line, pixel, run->length*page->pixel_bytes);
+            line += run->length*page->pixel_bytes;
+        }
+        else if(page->pixel_bytes == 1)
+        {
+            memset(line, *pixel, run->length);
+            line += run->length;
+        }
+        else
+        {
+            for(j = 0 ; j < run->length ; ++j)
+            {
+                memcpy(line, pixel, page->pixel_bytes);
+                line += page->pixel_bytes;
+            }
+        }
+    }
+}
+
+int urf_page_bbox(struct urf_page * page, struct urf_box * box)
+{
+    unsigned left = page->width;
+    unsigned right = 0;
+    unsigned top = page->height;
+    unsigned bottom = 0;
+    unsigned line = 0;
+    unsigned pos, first, last;
+    struct urf_row * r;
+    struct urf_run * run;
+    size_t i;
+    uint32_t j;
+
+    for(i = 0 ; i < page->row_count ; ++i)
+    {
+        r = &page->rows[i];
+        pos = 0;
+        first = page->width;
+        last = 0;
+
+        for(j = 0 ; j < r->run_count ; ++j)
+        {
+            run = &page->runs[r->run + j];
+
+            if(!run->literal)
+            {
+                if(run->pixel != URF_PAGE_WHITE)
+                {
+                    if(first > pos)
+                        first = pos;
+                    last = pos+run->length;
+                }
+            }
+            else if(!pixel_is_white(page, run->pixel, run->length))
+            {
+                unsigned k = 0;
+                unsigned l = run->length;
+
+                while(pixel_is_white(page, run->pixel + k*page->pixel_bytes, 1))
+                    ++k;
+                while(pixel_is_white(page, run->pixel + (l-1)*page->pixel_bytes, 1))
+                    --l;
+
+                if(first > pos+k)
+                    first = pos+k;
+                last = pos+l;
+            }
+
+            pos += run->length;
+        }
+
+        if(first < last)
+        {
+            if(left > first)
+                left = first;
+            if(right < last)
+                right = last;
+            if(top > line)
+                top = line;
+            bottom = line+r->repeat;
+        }
+
+        line += r->repeat;
+    }
+
+    if(left >= right)
+    {
+        memset(box, 0, sizeof(*box));
+        return 1;
+    }
+
+    box->x = left;
+    box->y = top;
+    box->width = right-left;
+    box->height = bottom-top;
+
+    return 0;
+}
+
+// Pages mostly made of literal pixels are continuous-tone content
+#define AUTO_JPEG_LITERAL_PERCENT 50
+
+int urf_page_is_photographic(struct urf_page * page)
+{
+    unsigned long coded = page->stats.repeat_pixels + page->stats.literal_pixels;
+
+    return coded && (page->stats.literal_pixels*100 >= coded*AUTO_JPEG_LITERAL_PERCENT);
+}
+
+int urf_page_crop(struct urf_page * page, unsigned x, unsigned y, unsigned width, unsigned height)
+{
+    struct urf_row * rows;
+    struct urf_run * runs;
+    struct urf_row * r;
+    struct urf_run * run;
+    size_t row_count = 0;
+    size_t run_count = 0;
+    unsigned line = 0;
+    unsigned first, last, pos, start, end;
+    size_t i;
+    uint32_t j;
+
+    if(width == 0 || height == 0 ||
+       x > page->width || width > page->width-x ||
+       y > page->height || height > page->height-y)
+        return -1;
+
+    // Cropping never adds rows nor runs
+    rows = malloc(page->row_count*sizeof(struct urf_row));
+    runs = malloc(page->run_count*sizeof(struct urf_run));
+    if(rows == NULL || runs == NULL)
+    {
+        free(rows);
+        free(runs);
+        return -1;
+    }
+
+    for(i = 0 ; i < page->row_count ; ++i)
+    {
+        r = &page->rows[i];
+        first = (line > y ? line : y);
+        last = (line+r->repeat < y+height ? line+r->repeat : y+height);
+        line += r->repeat;
+
+        if(first >= last)
+            continue;
+
+        rows[row_count].run = run_count;
+        rows[row_count].repeat = last-first;
+
+        pos = 0;
+        for(j = 0 ; j < r->run_count ; ++j)
+        {
+            run = &page->runs[r->run + j];
+            start = (pos > x ? pos : x);
+            end = (pos+run->length < x+width ? pos+run->length : x+width);
+
+            if(start < end)
+            {
+                runs[run_count] = *run;
+                runs[run_count].length = end-start;
+                if(run->literal)
+                    runs[run_count].pixel += (start-pos)*page->pixel_bytes;
+                ++run_count;
+            }
+
+            pos += run->length;
+        }
+
+        rows[row_count].run_count = run_count-rows[row_count].run;
+        ++row_count;
+    }
+
+    free(page->rows);
+    free(page->runs);
+
+    page->rows = rows;
+    page->row_count = row_count;
+    page->row_alloc = page->row_count;
+    page->runs = runs;
+    page->run_count = run_count;
+    page->run_alloc = page->run_count;
+    page->width = width;
+    page->height = height;
+
+    return 0;
+}
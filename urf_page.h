@@ -0,0 +1,102 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @brief URF page kept in run-length form
+ * @file urf_page.h
+ * @author Neil 'Superna' Armstrong <superna9999@gmail.com> (C) 2010
+ */
+
+#ifndef URF_PAGE_H
+#define URF_PAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Offset of the white pixel every page keeps at the start of its pixel pool
+#define URF_PAGE_WHITE  0
+
+// A literal run stores `length` pixels, a repeat run stores one pixel
+struct urf_run
+{
+    uint32_t length;
+    uint32_t pixel;
+    uint8_t literal;
+};
+
+// A unique row, drawn `repeat` times
+struct urf_row
+{
+    uint32_t run;
+    uint32_t run_count;
+    uint32_t repeat;
+};
+
+struct urf_page_stats
+{
+    unsigned long repeat_pixels;
+    unsigned long literal_pixels;
+    unsigned long blank_pixels;
+};
+
+struct urf_box
+{
+    unsigned x;
+    unsigned y;
+    unsigned width;
+    unsigned height;
+};
+
+struct urf_page
+{
+    unsigned width;
+    unsigned height;
+    unsigned bpp;
+    unsigned pixel_bytes;
+
+    struct urf_row * rows;
+    size_t row_count;
+    size_t row_alloc;
+
+    struct urf_run * runs;
+    size_t run_count;
+    size_t run_alloc;
+
+    uint8_t * pixels;
+    size_t pixel_size;
+    size_t pixel_alloc;
+
+    struct urf_page_stats stats;
+};
+
+/*
+ * Reads the raster following a page header. Rows always add up to the
+ * page height, a truncated raster is padded with white.
+ * Returns 0, 1 on premature EOF, -1 on allocation error.
+ */
+int urf_page_decode(int fd, unsigned width, unsigned height, unsigned bpp, struct urf_page * page);
+void urf_page_free(struct urf_page * page);
+
+size_t urf_page_memory(struct urf_page * page);
+
+// Expands a unique row to width*pixel_bytes bytes, URF (RGB) byte order
+void urf_page_expand_row(struct urf_page * page, unsigned row, uint8_t line[]);
+
+int urf_page_is_photographic(struct urf_page * page);
+
+// Bounding box of the non-white pixels, returns 1 and an empty box for a blank page
+int urf_page_bbox(struct urf_page * page, struct urf_box * box);
+
+int urf_page_crop(struct urf_page * page, unsigned x, unsigned y, unsigned width, unsigned height);
+
+#endif
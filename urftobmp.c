@@ -12,11 +12,12 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
- * @brief Decode URF  to a BMP file
+ * @brief Decode URF  to BMP, JPEG or Netpbm files
  * @file urf_decode.c
  * @author Neil 'Superna' Armstrong <superna9999@gmail.com> (C) 2010
  */
 
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -25,6 +26,11 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <jpeglib.h>
+#include "urf_page.h"
 
 #define PROGRAM "urftobmp"
 
@@ -38,7 +44,8 @@
 
 void die(char * str)
 {
-    printf("CRIT: (" PROGRAM ") die(%s) [%m]\n", str);
+    // stdout may carry the page stream
+    fprintf(stderr, "CRIT: (" PROGRAM ") die(%s) [%m]\n", str);
     exit(1);
 }
 
@@ -83,13 +90,13 @@ typedef enum {
 struct bmp_info
 {
     void * data;
-    uint8_t * bitmap;
     unsigned width;
     unsigned height;
     unsigned stride_bytes;
     unsigned pixel_bytes;
     unsigned line_bytes;
     unsigned file_size;
+    unsigned header_size;
     unsigned bitmap_size;
     unsigned bitmap_offset;
     unsigned bpp;
@@ -125,7 +132,9 @@ int create_bmp_file(unsigned width, unsigned height, struct bmp_info * info, int
                      sizeof(struct bmpfile_magic) +
                      sizeof(struct bmpfile_header) +
                      sizeof(BITMAPINFOHEADER);
-    data = malloc(data_size);
+
+    // Only the headers are kept in memory, rows are written from the run page
+    data = malloc(raw_pos);
 
     if(data == NULL)
     {
@@ -159,17 +168,14 @@ int create_bmp_file(unsigned width, unsigned height, struct bmp_info * info, int
     dib->ncolors = 0;
     dib->nimpcolors = 0;
 
-    // Blank it
-    memset(data+raw_pos, 0xFF, raw_size);
-
     info->data = data;
-    info->bitmap = (data+raw_pos);
     info->width = width;
     info->height = height;
     info->stride_bytes = line_size;
     info->pixel_bytes = pixel_bytes;
     info->line_bytes = (width*info->pixel_bytes);
     info->file_size = data_size;
+    info->header_size = raw_pos;
     info->bitmap_size = raw_size;
     info->bitmap_offset = raw_pos;
     info->bpp = bpp;
@@ -177,18 +183,415 @@ int create_bmp_file(unsigned width, unsigned height, struct bmp_info * info, int
     return 0;
 }
 
-void bmp_set_line(struct bmp_info * info, int line_n, uint8_t line[])
+int write_bmp_file(int fd, struct bmp_info * info, struct urf_page * page)
+{
+    uint8_t * line;
+    uint8_t * stride;
+    unsigned i, j, n;
+    size_t row;
+
+    if(write(fd, info->data, info->header_size) == -1)
+        return -1;
+
+    line = malloc(info->line_bytes);
+    stride = malloc(info->stride_bytes);
+    if(line == NULL || stride == NULL)
+    {
+        free(line);
+        free(stride);
+        return -1;
+    }
+
+    // Blank the stride padding
+    memset(stride, 0xFF, info->stride_bytes);
+
+    // BMP is stored bottom-up
+    for(row = page->row_count ; row-- > 0 ; )
+    {
+        urf_page_expand_row(page, row, line);
+
+        // URF pixels are RGB, BMP wants BGR
+        for(i = 0 ; i < info->line_bytes ; i += info->pixel_bytes)
+            for(j = 0 ; j < info->pixel_bytes ; ++j)
+                stride[i + j] = line[i + (info->pixel_bytes-j-1)];
+
+        for(n = 0 ; n < page->rows[row].repeat ; ++n)
+        {
+            if(write(fd, stride, info->stride_bytes) == -1)
+            {
+                free(line);
+                free(stride);
+                return -1;
+            }
+        }
+    }
+
+    free(line);
+    free(stride);
+
+    return 0;
+}
+
+//------------- JPEG ---------------
+
+struct jpg_info
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    FILE * file;
+    unsigned width;
+    unsigned height;
+    unsigned pixel_bytes;
+    unsigned line_bytes;
+    unsigned next_line;
+};
+
+int create_jpg_file(char * filename, unsigned width, unsigned height, int bpp, unsigned dpi,
+                    int quality, int subsampling, struct jpg_info * info)
+{
+    switch(bpp)
+    {
+        case 8:
+        case 24:
+            break;
+        default:
+            printf("TODO: Other bpp handling...\n");
+            return -1;
+    }
+
+    info->file = fopen(filename, "wb");
+    if(info->file == NULL)
+    {
+        printf("JPEG open error... (%m)\n");
+        return -1;
+    }
+
+    info->cinfo.err = jpeg_std_error(&info->jerr);
+    jpeg_create_compress(&info->cinfo);
+    jpeg_stdio_dest(&info->cinfo, info->file);
+
+    info->cinfo.image_width = width;
+    info->cinfo.image_height = height;
+    info->cinfo.input_components = bpp/8;
+    info->cinfo.in_color_space = (bpp == 8 ? JCS_GRAYSCALE : JCS_RGB);
+
+    jpeg_set_defaults(&info->cinfo);
+    jpeg_set_quality(&info->cinfo, quality, TRUE);
+
+    // Luma sampling factors, chroma stays at 1x1
+    if(bpp == 24)
+    {
+        info->cinfo.comp_info[0].h_samp_factor = (subsampling == 444 ? 1 : 2);
+        info->cinfo.comp_info[0].v_samp_factor = (subsampling == 420 ? 2 : 1);
+    }
+
+    info->cinfo.density_unit = 1;
+    info->cinfo.X_density = dpi;
+    info->cinfo.Y_density = dpi;
+
+    jpeg_start_compress(&info->cinfo, TRUE);
+
+    info->width = width;
+    info->height = height;
+    info->pixel_bytes = bpp/8;
+    info->line_bytes = (width*info->pixel_bytes);
+    info->next_line = 0;
+
+    return 0;
+}
+
+int jpg_set_line(struct jpg_info * info, unsigned line_n, uint8_t line[])
+{
+    JSAMPROW row = line;
+
+    dprintf("jpg_set_line(%u)\n", line_n);
+
+    // libjpeg only accepts scanlines in order
+    if(line_n >= info->height || line_n != info->next_line)
+    {
+        dprintf("Bad line %u\n", line_n);
+        return -1;
+    }
+
+    if(jpeg_write_scanlines(&info->cinfo, &row, 1) != 1)
+        return -1;
+
+    ++info->next_line;
+
+    return 0;
+}
+
+int write_jpg_file(struct jpg_info * info, struct urf_page * page)
+{
+    uint8_t * line;
+    unsigned n;
+    size_t row;
+    int ret = 0;
+
+    line = malloc(info->line_bytes);
+    if(line == NULL)
+        return -1;
+
+    for(row = 0 ; row < page->row_count && ret == 0 ; ++row)
+    {
+        urf_page_expand_row(page, row, line);
+        for(n = 0 ; n < page->rows[row].repeat && ret == 0 ; ++n)
+            ret = jpg_set_line(info, info->next_line, line);
+    }
+
+    free(line);
+
+    return ret;
+}
+
+int close_jpg_file(struct jpg_info * info)
+{
+    jpeg_finish_compress(&info->cinfo);
+    jpeg_destroy_compress(&info->cinfo);
+    fclose(info->file);
+
+    return 0;
+}
+
+//------------- Netpbm ---------------
+
+typedef enum {
+    OUTPUT_BMP = 0,
+    OUTPUT_JPEG,
+    OUTPUT_PAM,
+    OUTPUT_PPM,
+    OUTPUT_PGM,
+} output_format_t;
+
+#define PNM_BUFFER_SIZE (1024*1024)
+
+struct pnm_stream
+{
+    int fd;
+    uint8_t * buffer;
+    size_t size;
+    size_t start;
+    size_t pos;
+};
+
+int open_pnm_stream(int fd, struct pnm_stream * s)
+{
+    struct stat st;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->size = PNM_BUFFER_SIZE;
+
+    // A pipe as big as a batch takes it in one write(), the kernel may refuse
+    if(fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
+        fcntl(fd, F_SETPIPE_SZ, PNM_BUFFER_SIZE);
+
+    s->buffer = malloc(s->size);
+    if(s->buffer == NULL)
+        return -1;
+
+    dprintf("open_pnm_stream : %zu bytes batches\n", s->size);
+
+    return 0;
+}
+
+int pnm_stream_flush(struct pnm_stream * s)
+{
+    ssize_t ret;
+
+    while(s->start < s->pos)
+    {
+        ret = write(s->fd, s->buffer + s->start, s->pos - s->start);
+        if(ret == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        s->start += ret;
+    }
+
+    // write() copied the data, the buffer can be reused
+    s->start = s->pos = 0;
+
+    return 0;
+}
+
+// Room for len contiguous bytes in the stream buffer, NULL if len is too big to be buffered
+uint8_t * pnm_stream_reserve(struct pnm_stream * s, size_t len)
+{
+    if(len > s->size)
+        return NULL;
+
+    if(s->pos + len > s->size && pnm_stream_flush(s) != 0)
+        return NULL;
+
+    return s->buffer + s->pos;
+}
+
+int pnm_stream_commit(struct pnm_stream * s, size_t len)
+{
+    s->pos += len;
+
+    if(s->pos == s->size)
+        return pnm_stream_flush(s);
+
+    return 0;
+}
+
+int pnm_stream_write(struct pnm_stream * s, const uint8_t * data, size_t len)
+{
+    uint8_t * dst;
+    ssize_t ret;
+
+    if((dst = pnm_stream_reserve(s, len)) != NULL)
+    {
+        memcpy(dst, data, len);
+        return pnm_stream_commit(s, len);
+    }
+
+    // Too big for a batch, write it directly
+    if(pnm_stream_flush(s) != 0)
+        return -1;
+
+    while(len)
+    {
+        ret = write(s->fd, data, len);
+        if(ret == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+int close_pnm_stream(struct pnm_stream * s)
+{
+    int ret = pnm_stream_flush(s);
+
+    free(s->buffer);
+    s->buffer = NULL;
+
+    return ret;
+}
+
+void pnm_convert_line(output_format_t format, unsigned pixel_bytes, unsigned width, uint8_t src[], uint8_t dst[])
+{
+    unsigned i;
+
+    if(format == OUTPUT_PPM && pixel_bytes == 1)
+    {
+        for(i = 0 ; i < width ; ++i)
+            dst[3*i] = dst[3*i+1] = dst[3*i+2] = src[i];
+    }
+    else if(format == OUTPUT_PGM && pixel_bytes == 3)
+    {
+        // ITU-R BT.601 luma
+        for(i = 0 ; i < width ; ++i)
+            dst[i] = (77*src[3*i] + 150*src[3*i+1] + 29*src[3*i+2]) >> 8;
+    }
+    else
+        memcpy(dst, src, width*pixel_bytes);
+}
+
+int write_pnm_page(struct pnm_stream * s, output_format_t format, struct urf_page * page)
 {
-    dprintf("bmp_set_line(%d)\n", line_n);
+    char header[128];
+    int header_len;
+    unsigned out_bytes;
+    size_t out_line;
+    uint8_t * line;
+    uint8_t * dst;
+    uint8_t * last;
+    unsigned n;
+    size_t row;
+    int ret = 0;
+
+    switch(page->bpp)
+    {
+        case 8:
+        case 24:
+            break;
+        default:
+            fprintf(stderr, "TODO: Other bpp handling...\n");
+            return -1;
+    }
+
+    switch(format)
+    {
+        case OUTPUT_PPM:
+            out_bytes = 3;
+            header_len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", page->width, page->height);
+            break;
+        case OUTPUT_PGM:
+            out_bytes = 1;
+            header_len = snprintf(header, sizeof(header), "P5\n%u %u\n255\n", page->width, page->height);
+            break;
+        default:
+            out_bytes = page->pixel_bytes;
+            header_len = snprintf(header, sizeof(header),
+                                  "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                                  page->width, page->height, out_bytes,
+                                  (out_bytes == 1 ? "GRAYSCALE" : "RGB"));
+            break;
+    }
+
+    out_line = (size_t)page->width*out_bytes;
+
+    if(pnm_stream_write(s, (uint8_t *)header, header_len) != 0)
+        return -1;
+
+    line = malloc((size_t)page->width*page->pixel_bytes);
+    last = malloc(out_line);
+    if(line == NULL || last == NULL)
+    {
+        free(line);
+        free(last);
+        return -1;
+    }
 
-    if(line_n > info->height)
+    for(row = 0 ; row < page->row_count && ret == 0 ; ++row)
     {
-        dprintf("Bad line %d\n", line_n);
-        return;
+        // Rows are produced in place in the stream buffer when they fit
+        if(out_bytes == page->pixel_bytes && (dst = pnm_stream_reserve(s, out_line)) != NULL)
+            urf_page_expand_row(page, row, dst);
+        else
+        {
+            urf_page_expand_row(page, row, line);
+            if((dst = pnm_stream_reserve(s, out_line)) != NULL)
+                pnm_convert_line(format, page->pixel_bytes, page->width, line, dst);
+        }
+
+        if(dst != NULL)
+        {
+            // Keep a copy for repeats, dst belongs to the stream once committed
+            if(page->rows[row].repeat > 1)
+                memcpy(last, dst, out_line);
+            ret = pnm_stream_commit(s, out_line);
+        }
+        else
+        {
+            pnm_convert_line(format, page->pixel_bytes, page->width, line, last);
+            ret = pnm_stream_write(s, last, out_line);
+        }
+
+        for(n = 1 ; n < page->rows[row].repeat && ret == 0 ; ++n)
+            ret = pnm_stream_write(s, last, out_line);
     }
 
-    memcpy(&info->bitmap[(info->height-line_n-1)*info->stride_bytes],
-           line, info->line_bytes);
+    free(line);
+    free(last);
+
+    if(ret == 0)
+        ret = pnm_stream_flush(s);
+
+    return ret;
 }
 
 // Data are in network endianness
@@ -211,143 +614,131 @@ struct urf_page_header {
     uint32_t unknown3;
 } __attribute__((__packed__));
 
-int decode_raster(int fd, int width, int height, int bpp, struct bmp_info * bmp)
-{
-    // We should be at raster start
-    int i, j;
-    int cur_line = 0;
-    int pos = 0;
-    uint8_t line_repeat_byte = 0;
-    unsigned line_repeat = 0;
-    int8_t packbit_code = 0;
-    int pixel_size = (bpp/8);
-    uint8_t * pixel_container;
-    uint8_t * line_container;
-
-    pixel_container = malloc(pixel_size);
-    line_container = malloc(pixel_size*width);
-
-    do
-    {
-        if(read(fd, &line_repeat_byte, 1) < 1)
-        {
-            dprintf("l%06d : line_repeat EOF at %lu\n", cur_line, lseek(fd, 0, SEEK_CUR));
-            return 1;
-        }
-
-        line_repeat = (unsigned)line_repeat_byte + 1;
+#define FORMAT_PAGE "%s%04d.%s"
+#define DEFAULT_PREFIX "page"
 
-        dprintf("l%06d : next actions for %d lines\n", cur_line, line_repeat);
-
-        // Start of line
-        pos = 0;
+void usage(char * name)
+{
+    fprintf(stderr, "Usage: %s [options] <input.urf>\n", name);
+    fprintf(stderr, "  -f, --format bmp|jpeg|pam|ppm|pgm  page file format (default bmp)\n");
+    fprintf(stderr, "  -o, --output prefix|-      page files are <prefix>NNNN.<format> (default page),\n");
+    fprintf(stderr, "                             - streams Netpbm pages to stdout\n");
+    fprintf(stderr, "  -a, --auto                 JPEG for photographic pages, BMP otherwise\n");
+    fprintf(stderr, "  -q, --quality 1-100        JPEG quality (default 85)\n");
+    fprintf(stderr, "  -s, --subsampling 444|422|420  JPEG chroma subsampling (default 420)\n");
+    fprintf(stderr, "  -t, --autotrim             only write the non-white content of each page\n");
+}
 
-        do
+int main(int argc, char **argv)
+{
+    int fd, page, fd_bmp, fd_pnm, ret, opt;
+    int auto_format = 0;
+    int autotrim = 0;
+    int quality = 85;
+    int subsampling = 420;
+    output_format_t format = OUTPUT_BMP;
+    char * prefix = DEFAULT_PREFIX;
+    int to_stdout = 0;
+    int netpbm;
+    struct urf_file_header head, head_orig;
+    struct urf_page_header page_header, page_header_orig;
+    output_format_t page_format;
+    struct urf_page urf;
+    struct urf_box box;
+    struct bmp_info bmp;
+    struct jpg_info jpg;
+    struct pnm_stream pnm;
+    char outfile[255];
+    static struct option long_options[] = {
+        {"format",      required_argument, NULL, 'f'},
+        {"output",      required_argument, NULL, 'o'},
+        {"auto",        no_argument,       NULL, 'a'},
+        {"quality",     required_argument, NULL, 'q'},
+        {"subsampling", required_argument, NULL, 's'},
+        {"autotrim",    no_argument,       NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while((opt = getopt_long(argc, argv, "f:o:aq:s:t", long_options, NULL)) != -1)
+    {
+        switch(opt)
         {
-            if(read(fd, &packbit_code, 1) < 1)
-            {
-                dprintf("p%06dl%06d : packbit_code EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
-                return 1;
-            }
-
-            dprintf("p%06dl%06d: Raster code %02X='%d'.\n", pos, cur_line, (uint8_t)packbit_code, packbit_code);
-
-            if(packbit_code == -128)
-            {
-                dprintf("\tp%06dl%06d : blank rest of line.\n", pos, cur_line);
-                memset((line_container+(pos*pixel_size)), 0xFF, (pixel_size*(width-pos)));
-                pos = width;
-                break;
-            }
-            else if(packbit_code >= 0 && packbit_code <= 127)
-            {
-                int n = (packbit_code+1);
-
-                //Read pixel
-                if(read(fd, pixel_container, pixel_size) < pixel_size)
+            case 'f':
+                if(strcmp(optarg, "bmp") == 0)
+                    format = OUTPUT_BMP;
+                else if(strcmp(optarg, "jpeg") == 0 || strcmp(optarg, "jpg") == 0)
+                    format = OUTPUT_JPEG;
+                else if(strcmp(optarg, "pam") == 0)
+                    format = OUTPUT_PAM;
+                else if(strcmp(optarg, "ppm") == 0)
+                    format = OUTPUT_PPM;
+                else if(strcmp(optarg, "pgm") == 0)
+                    format = OUTPUT_PGM;
+                else
                 {
-                    dprintf("p%06dl%06d : pixel repeat EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
+                    usage(argv[0]);
                     return 1;
                 }
-
-                dprintf("\tp%06dl%06d : Repeat pixel '", pos, cur_line);
-                for(j = 0 ; j < pixel_size ; ++j)
-                    dprintf("%02X ", pixel_container[j]);
-                dprintf("' for %d times.\n", n);
-
-                for(i = 0 ; i < n ; ++i)
-                {
-                    //for(j = pixel_size-1 ; j >= 0 ; --j)
-                    for(j = 0 ; j < pixel_size ; ++j)
-                        line_container[pixel_size*pos + j] = pixel_container[(pixel_size-j-1)];
-                    ++pos;
-                    if(pos >= width)
-                        break;
-                }
-
-                if(i < n && pos >= width)
-                {
-                    dprintf("\tp%06dl%06d : Forced end of line for pixel repeat.\n", pos, cur_line);
-                }
-                
-                if(pos >= width)
-                    break;
-            }
-            else if(packbit_code > -128 && packbit_code < 0)
-            {
-                int n = (-(int)packbit_code)+1;
-
-                dprintf("\tp%06dl%06d : Copy %d verbatim pixels.\n", pos, cur_line, n);
-
-                for(i = 0 ; i < n ; ++i)
+                break;
+            case 'o':
+                if(strcmp(optarg, "-") == 0)
+                    to_stdout = 1;
+                else
+                    prefix = optarg;
+                break;
+            case 'a':
+                auto_format = 1;
+                break;
+            case 'q':
+                quality = atoi(optarg);
+                if(quality < 1 || quality > 100)
                 {
-                    if(read(fd, pixel_container, pixel_size) < pixel_size)
-                    {
-                        dprintf("p%06dl%06d : literal_pixel EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
-                        return 1;
-                    }
-                    //Invert pixels, should be programmable
-                    for(j = 0 ; j < pixel_size ; ++j)
-                        line_container[pixel_size*pos + j] = pixel_container[(pixel_size-j-1)];
-                    ++pos;
-                    if(pos >= width)
-                        break;
+                    usage(argv[0]);
+                    return 1;
                 }
-
-                if(i < n && pos >= width)
+                break;
+            case 's':
+                subsampling = atoi(optarg);
+                if(subsampling != 444 && subsampling != 422 && subsampling != 420)
                 {
-                    dprintf("\tp%06dl%06d : Forced end of line for pixel copy.\n", pos, cur_line);
+                    usage(argv[0]);
+                    return 1;
                 }
-                
-                if(pos >= width)
-                    break;
-            }
+                break;
+            case 't':
+                autotrim = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
         }
-        while(pos < width);
+    }
+
+    if(optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
 
-        dprintf("\tl%06d : End Of line, drawing %d times.\n", cur_line, line_repeat);
+    netpbm = (format == OUTPUT_PAM || format == OUTPUT_PPM || format == OUTPUT_PGM);
 
-        // write lines
-        for(i = 0 ; i < line_repeat ; ++i)
-        {
-            bmp_set_line(bmp, cur_line, line_container);
-            ++cur_line;
-        }
+    // Only Netpbm pages can be concatenated in a stream
+    if(to_stdout && !netpbm)
+    {
+        fprintf(stderr, "Only pam, ppm and pgm can be written to stdout\n");
+        return 1;
     }
-    while(cur_line < height);
-}
 
-#define FORMAT_BMP  "page%04d.bmp"
+    // -a picks between JPEG and BMP
+    if(auto_format && netpbm)
+    {
+        fprintf(stderr, "-a can not be used with Netpbm formats\n");
+        return 1;
+    }
 
-int main(int argc, char **argv)
-{
-    int fd, page, fd_bmp, ret;
-    struct urf_file_header head, head_orig;
-    struct urf_page_header page_header, page_header_orig;
-    struct bmp_info bmp;
-    char bmpfile[255];
+    if(to_stdout && open_pnm_stream(STDOUT_FILENO, &pnm) != 0) die("Unable to open output stream");
 
-    if((fd = open(argv[1], O_RDONLY)) == -1) die("Unable to open unirast file");
+    if((fd = open(argv[optind], O_RDONLY)) == -1) die("Unable to open unirast file");
 
     lseek(fd, 0, SEEK_SET);
 
@@ -389,22 +780,81 @@ int main(int argc, char **argv)
         iprintf("Size : %dx%d pixels\n", page_header.width, page_header.height);
         iprintf("Dots per Inches : %d\n", page_header.dot_per_inch);
 
-        if(create_bmp_file(page_header.width, page_header.height, &bmp, page_header.bpp) != 0) die("Unable to create BMP file");
-        sprintf(bmpfile, FORMAT_BMP, page);
+        if(urf_page_decode(fd, page_header.width, page_header.height, page_header.bpp, &urf) == -1) die("Unable to decode page");
+
+        iprintf("Pixels : %lu repeated, %lu literal, %lu blank\n",
+                urf.stats.repeat_pixels, urf.stats.literal_pixels, urf.stats.blank_pixels);
+        iprintf("Runs : %zu rows, %zu runs, %zu bytes\n", urf.row_count, urf.run_count, urf_page_memory(&urf));
+
+        if(urf_page_bbox(&urf, &box) == 0)
+            iprintf("Content : %ux%u pixels at %u,%u\n", box.width, box.height, box.x, box.y);
+        else
+            iprintf("Page %d is blank\n", page);
+
+        // Pages without pixels have nothing to trim
+        if(autotrim && urf.width && urf.height)
+        {
+            // Keep a single white pixel for blank pages
+            if(box.width == 0)
+                box.width = box.height = 1;
+            if(urf_page_crop(&urf, box.x, box.y, box.width, box.height) != 0) die("Unable to trim page");
+        }
+
+        page_format = format;
+        if(auto_format)
+            page_format = (urf_page_is_photographic(&urf) ? OUTPUT_JPEG : OUTPUT_BMP);
 
-		iprintf("BMP File '%s'\n", bmpfile);
+        if(page_format == OUTPUT_JPEG)
+        {
+            snprintf(outfile, sizeof(outfile), FORMAT_PAGE, prefix, page, "jpg");
 
-        decode_raster(fd, page_header.width, page_header.height, page_header.bpp, &bmp);
+            iprintf("JPEG File '%s'\n", outfile);
 
-        if((fd_bmp = open(bmpfile, O_CREAT|O_TRUNC|O_WRONLY, 0666)) == -1) die("Unable to open BMP file for writing");
-        if(fd_bmp >= 0)
+            if(create_jpg_file(outfile, urf.width, urf.height, urf.bpp,
+                               page_header.dot_per_inch, quality, subsampling, &jpg) != 0) die("Unable to create JPEG file");
+            if(write_jpg_file(&jpg, &urf) != 0) die("Unable to write JPEG file");
+            close_jpg_file(&jpg);
+        }
+        else if(page_format != OUTPUT_BMP)
         {
-            if(write(fd_bmp, bmp.data, bmp.file_size) == -1) die("Unable to write BMP file");
-            close(fd_bmp);
+            if(to_stdout)
+            {
+                if(write_pnm_page(&pnm, page_format, &urf) != 0) die("Unable to write Netpbm page");
+            }
+            else
+            {
+                snprintf(outfile, sizeof(outfile), FORMAT_PAGE, prefix, page,
+                         (page_format == OUTPUT_PAM ? "pam" : page_format == OUTPUT_PPM ? "ppm" : "pgm"));
+
+                iprintf("Netpbm File '%s'\n", outfile);
+
+                if((fd_pnm = open(outfile, O_CREAT|O_TRUNC|O_WRONLY, 0666)) == -1) die("Unable to open Netpbm file for writing");
+                if(open_pnm_stream(fd_pnm, &pnm) != 0) die("Unable to open output stream");
+                if(write_pnm_page(&pnm, page_format, &urf) != 0) die("Unable to write Netpbm page");
+                close_pnm_stream(&pnm);
+                close(fd_pnm);
+            }
         }
-        free(bmp.data);
-        memset(&bmp, 0, sizeof(bmp));
+        else
+        {
+            if(create_bmp_file(urf.width, urf.height, &bmp, urf.bpp) != 0) die("Unable to create BMP file");
+            snprintf(outfile, sizeof(outfile), FORMAT_PAGE, prefix, page, "bmp");
+
+            iprintf("BMP File '%s'\n", outfile);
+
+            if((fd_bmp = open(outfile, O_CREAT|O_TRUNC|O_WRONLY, 0666)) == -1) die("Unable to open BMP file for writing");
+            if(fd_bmp >= 0)
+            {
+                if(write_bmp_file(fd_bmp, &bmp, &urf) == -1) die("Unable to write BMP file");
+                close(fd_bmp);
+            }
+            free(bmp.data);
+        }
+
+        urf_page_free(&urf);
     }
 
+    if(to_stdout && close_pnm_stream(&pnm) != 0) die("Unable to write output stream");
+
     return 0;
 }
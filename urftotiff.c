@@ -25,7 +25,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <arpa/inet.h>
 #include "tiffio.h"
+#include "urf_page.h"
 
 #define PROGRAM "urftotiff"
 
@@ -68,7 +71,8 @@ int create_tiff_file(struct tiff_info * info, char * filename, unsigned pagecoun
     return 0;
 }
 
-int add_tiff_page(struct tiff_info * info, int pagen, unsigned width, unsigned height, int bpp, unsigned dpi)
+int add_tiff_page(struct tiff_info * info, int pagen, unsigned width, unsigned height, int bpp, unsigned dpi,
+                  int compression, int quality, int subsampling)
 {
     if(pagen)
         TIFFWriteDirectory(info->tif);
@@ -79,15 +83,33 @@ int add_tiff_page(struct tiff_info * info, int pagen, unsigned width, unsigned h
     TIFFSetField(info->tif, TIFFTAG_SAMPLESPERPIXEL, bpp/8);
     TIFFSetField(info->tif, TIFFTAG_BITSPERSAMPLE, 8);
     TIFFSetField(info->tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    TIFFSetField(info->tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+
+    // Compression first, the JPEG codec rounds the strip size to its MCU height
+    TIFFSetField(info->tif, TIFFTAG_COMPRESSION, compression);
+
+    if(compression == COMPRESSION_JPEG)
+    {
+        TIFFSetField(info->tif, TIFFTAG_JPEGQUALITY, quality);
+        if(bpp == 24)
+        {
+            TIFFSetField(info->tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_YCBCR);
+            TIFFSetField(info->tif, TIFFTAG_YCBCRSUBSAMPLING,
+                         (subsampling == 444 ? 1 : 2), (subsampling == 420 ? 2 : 1));
+            // Let libjpeg do the RGB to YCbCr conversion on our scanlines
+            TIFFSetField(info->tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+        }
+        else
+            TIFFSetField(info->tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    }
+    else
+        TIFFSetField(info->tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+
     TIFFSetField(info->tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(info->tif, (uint32_t)-1));
 
     TIFFSetField(info->tif, TIFFTAG_XRESOLUTION, (float)dpi);
     TIFFSetField(info->tif, TIFFTAG_YRESOLUTION, (float)dpi);
     TIFFSetField(info->tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
 
-    TIFFSetField(info->tif, TIFFTAG_COMPRESSION, COMPRESSION_PACKBITS);
-
     TIFFSetField(info->tif, TIFFTAG_PAGENUMBER, pagen, info->pagecount);
 
     info->width = width;
@@ -110,7 +132,7 @@ void tiff_set_line(struct tiff_info * info, int line_n, uint8_t line[])
 {
     dprintf("tiff_set_line(%d)\n", line_n);
 
-    if(line_n > info->height)
+    if(line_n >= info->height)
     {
         dprintf("Bad line %d\n", line_n);
         return;
@@ -119,6 +141,29 @@ void tiff_set_line(struct tiff_info * info, int line_n, uint8_t line[])
     TIFFWriteScanline(info->tif, line, line_n, 0);
 }
 
+int write_tiff_page(struct tiff_info * info, struct urf_page * page)
+{
+    uint8_t * line;
+    unsigned n;
+    unsigned cur_line = 0;
+    size_t row;
+
+    line = malloc(info->line_bytes);
+    if(line == NULL)
+        return -1;
+
+    for(row = 0 ; row < page->row_count ; ++row)
+    {
+        urf_page_expand_row(page, row, line);
+        for(n = 0 ; n < page->rows[row].repeat ; ++n)
+            tiff_set_line(info, cur_line++, line);
+    }
+
+    free(line);
+
+    return 0;
+}
+
 // Data are in network endianness
 struct urf_file_header {
     char unirast[8];
@@ -139,146 +184,89 @@ struct urf_page_header {
     uint32_t unknown3;
 } __attribute__((__packed__));
 
-int decode_raster(int fd, int width, int height, int bpp, struct tiff_info * tiff)
+void usage(char * name)
 {
-    // We should be at raster start
-    int i, j;
-    int cur_line = 0;
-    int pos = 0;
-    uint8_t line_repeat_byte = 0;
-    unsigned line_repeat = 0;
-    int8_t packbit_code = 0;
-    int pixel_size = (bpp/8);
-    uint8_t * pixel_container;
-    uint8_t * line_container;
-
-    pixel_container = malloc(pixel_size);
-    line_container = malloc(pixel_size*width);
-
-    do
-    {
-        if(read(fd, &line_repeat_byte, 1) < 1)
-        {
-            dprintf("l%06d : line_repeat EOF at %lu\n", cur_line, lseek(fd, 0, SEEK_CUR));
-            return 1;
-        }
-
-        line_repeat = (unsigned)line_repeat_byte + 1;
-
-        dprintf("l%06d : next actions for %d lines\n", cur_line, line_repeat);
-
-        // Start of line
-        pos = 0;
+    fprintf(stderr, "Usage: %s [options] <input.urf> <output.tiff>\n", name);
+    fprintf(stderr, "  -c, --compression packbits|jpeg  page compression (default packbits)\n");
+    fprintf(stderr, "  -a, --auto                 JPEG for photographic pages, PackBits otherwise\n");
+    fprintf(stderr, "  -q, --quality 1-100        JPEG quality (default 85)\n");
+    fprintf(stderr, "  -s, --subsampling 444|422|420  JPEG chroma subsampling (default 420)\n");
+    fprintf(stderr, "  -t, --autotrim             only write the non-white content of each page\n");
+}
 
-        do
+int main(int argc, char **argv)
+{
+    int fd, page, fd_tiff, ret, opt;
+    int auto_compression = 0;
+    int autotrim = 0;
+    int compression = COMPRESSION_PACKBITS;
+    int page_compression;
+    int quality = 85;
+    int subsampling = 420;
+    struct urf_file_header head, head_orig;
+    struct urf_page_header page_header, page_header_orig;
+    struct urf_page urf;
+    struct urf_box box;
+    struct tiff_info tiff;
+    static struct option long_options[] = {
+        {"compression", required_argument, NULL, 'c'},
+        {"auto",        no_argument,       NULL, 'a'},
+        {"quality",     required_argument, NULL, 'q'},
+        {"subsampling", required_argument, NULL, 's'},
+        {"autotrim",    no_argument,       NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while((opt = getopt_long(argc, argv, "c:aq:s:t", long_options, NULL)) != -1)
+    {
+        switch(opt)
         {
-            if(read(fd, &packbit_code, 1) < 1)
-            {
-                dprintf("p%06dl%06d : packbit_code EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
-                return 1;
-            }
-
-            dprintf("p%06dl%06d: Raster code %02X='%d'.\n", pos, cur_line, (uint8_t)packbit_code, packbit_code);
-
-            if(packbit_code == -128)
-            {
-                dprintf("\tp%06dl%06d : blank rest of line.\n", pos, cur_line);
-                memset((line_container+(pos*pixel_size)), 0xFF, (pixel_size*(width-pos)));
-                pos = width;
-                break;
-            }
-            else if(packbit_code >= 0 && packbit_code <= 127)
-            {
-                int n = (packbit_code+1);
-
-                //Read pixel
-                if(read(fd, pixel_container, pixel_size) < pixel_size)
+            case 'c':
+                if(strcmp(optarg, "packbits") == 0)
+                    compression = COMPRESSION_PACKBITS;
+                else if(strcmp(optarg, "jpeg") == 0 || strcmp(optarg, "jpg") == 0)
+                    compression = COMPRESSION_JPEG;
+                else
                 {
-                    dprintf("p%06dl%06d : pixel repeat EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
+                    usage(argv[0]);
                     return 1;
                 }
-
-                dprintf("\tp%06dl%06d : Repeat pixel '", pos, cur_line);
-                for(j = 0 ; j < pixel_size ; ++j)
-                    dprintf("%02X ", pixel_container[j]);
-                dprintf("' for %d times.\n", n);
-
-                for(i = 0 ; i < n ; ++i)
-                {
-                    //for(j = pixel_size-1 ; j >= 0 ; --j)
-                    for(j = 0 ; j < pixel_size ; ++j)
-                        line_container[pixel_size*pos + j] = pixel_container[j];
-                    ++pos;
-                    if(pos >= width)
-                        break;
-                }
-
-                if(i < n && pos >= width)
-                {
-                    dprintf("\tp%06dl%06d : Forced end of line for pixel repeat.\n", pos, cur_line);
-                }
-                
-                if(pos >= width)
-                    break;
-            }
-            else if(packbit_code > -128 && packbit_code < 0)
-            {
-                int n = (-(int)packbit_code)+1;
-
-                dprintf("\tp%06dl%06d : Copy %d verbatim pixels.\n", pos, cur_line, n);
-
-                for(i = 0 ; i < n ; ++i)
+                break;
+            case 'a':
+                auto_compression = 1;
+                break;
+            case 'q':
+                quality = atoi(optarg);
+                if(quality < 1 || quality > 100)
                 {
-                    if(read(fd, pixel_container, pixel_size) < pixel_size)
-                    {
-                        dprintf("p%06dl%06d : literal_pixel EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
-                        return 1;
-                    }
-                    //Invert pixels, should be programmable
-                    for(j = 0 ; j < pixel_size ; ++j)
-                        line_container[pixel_size*pos + j] = pixel_container[j];
-                    ++pos;
-                    if(pos >= width)
-                        break;
+                    usage(argv[0]);
+                    return 1;
                 }
-
-                if(i < n && pos >= width)
+                break;
+            case 's':
+                subsampling = atoi(optarg);
+                if(subsampling != 444 && subsampling != 422 && subsampling != 420)
                 {
-                    dprintf("\tp%06dl%06d : Forced end of line for pixel copy.\n", pos, cur_line);
+                    usage(argv[0]);
+                    return 1;
                 }
-                
-                if(pos >= width)
-                    break;
-            }
-        }
-        while(pos < width);
-
-        dprintf("\tl%06d : End Of line, drawing %d times.\n", cur_line, line_repeat);
-
-        // write lines
-        for(i = 0 ; i < line_repeat ; ++i)
-        {
-            tiff_set_line(tiff, cur_line, line_container);
-            ++cur_line;
+                break;
+            case 't':
+                autotrim = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
         }
     }
-    while(cur_line < height);
-}
-
-int main(int argc, char **argv)
-{
-    int fd, page, fd_tiff, ret;
-    struct urf_file_header head, head_orig;
-    struct urf_page_header page_header, page_header_orig;
-    struct tiff_info tiff;
 
-    if(argc < 3)
+    if(argc - optind < 2)
     {
-        fprintf(stderr, "Usage: %s <input.urf> <output.tiff>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
 
-    if((fd = open(argv[1], O_RDONLY)) == -1) die("Unable to open unirast file");
+    if((fd = open(argv[optind], O_RDONLY)) == -1) die("Unable to open unirast file");
 
     lseek(fd, 0, SEEK_SET);
 
@@ -295,7 +283,7 @@ int main(int argc, char **argv)
 
     iprintf("%s file, with %d page(s).\n", head.unirast, head.page_count);
 
-    if(create_tiff_file(&tiff, argv[2], head.page_count) != 0) die("Unable to create TIFF file");
+    if(create_tiff_file(&tiff, argv[optind+1], head.page_count) != 0) die("Unable to create TIFF file");
 
     for(page = 0 ; page < head.page_count ; ++page)
     {
@@ -322,9 +310,45 @@ int main(int argc, char **argv)
         iprintf("Size : %dx%d pixels\n", page_header.width, page_header.height);
         iprintf("Dots per Inches : %d\n", page_header.dot_per_inch);
 
-        if(add_tiff_page(&tiff, page, page_header.width, page_header.height, page_header.bpp, page_header.dot_per_inch) != 0) die("Unable to create TIFF file");
+        if(urf_page_decode(fd, page_header.width, page_header.height, page_header.bpp, &urf) == -1) die("Unable to decode page");
+
+        iprintf("Pixels : %lu repeated, %lu literal, %lu blank\n",
+                urf.stats.repeat_pixels, urf.stats.literal_pixels, urf.stats.blank_pixels);
+        iprintf("Runs : %zu rows, %zu runs, %zu bytes\n", urf.row_count, urf.run_count, urf_page_memory(&urf));
+
+        if(urf_page_bbox(&urf, &box) == 0)
+            iprintf("Content : %ux%u pixels at %u,%u\n", box.width, box.height, box.x, box.y);
+        else
+            iprintf("Page %d is blank\n", page);
+
+        // Pages without pixels have nothing to trim
+        if(autotrim && urf.width && urf.height)
+        {
+            // Keep a single white pixel for blank pages
+            if(box.width == 0)
+                box.width = box.height = 1;
+            if(urf_page_crop(&urf, box.x, box.y, box.width, box.height) != 0) die("Unable to trim page");
+        }
+
+        page_compression = compression;
+        if(auto_compression)
+            page_compression = (urf_page_is_photographic(&urf) ? COMPRESSION_JPEG : COMPRESSION_PACKBITS);
+
+        iprintf("Compression : %s\n", (page_compression == COMPRESSION_JPEG ? "JPEG" : "PackBits"));
+
+        if(add_tiff_page(&tiff, page, urf.width, urf.height, urf.bpp, page_header.dot_per_inch,
+                         page_compression, quality, subsampling) != 0) die("Unable to create TIFF file");
+
+        // Remember where the trimmed content sat on the page
+        if(autotrim && page_header.dot_per_inch)
+        {
+            TIFFSetField(tiff.tif, TIFFTAG_XPOSITION, (float)box.x/page_header.dot_per_inch);
+            TIFFSetField(tiff.tif, TIFFTAG_YPOSITION, (float)box.y/page_header.dot_per_inch);
+        }
+
+        if(write_tiff_page(&tiff, &urf) != 0) die("Unable to write TIFF page");
 
-        decode_raster(fd, page_header.width, page_header.height, page_header.bpp, &tiff);
+        urf_page_free(&urf);
     }
 
     close_tiff_file(&tiff);